@@ -81,6 +81,15 @@ function [subj results] = cross_validation(subj,patin,regsname,selname,maskgroup
 % ALLOW_SINGLE_OBJECT (optional, default = false). By default,
 % CROSS_VALIDATION requires SELNAME to be a group. If
 % ALLOW_SINGLE_OBJECT == true, SELNAME can be a single object.
+%
+% PARFOR_WORKERS (optional, default = 0). If greater than 0, the
+% iterations get run with PARFOR on up to this many workers of the
+% current pool (see RUN_SUBJ_BATCH). Only each iteration's masked
+% pattern and selector get sent to the workers, not the whole SUBJ -
+% iterations that share a pattern and mask share the same copy in
+% the client. Non-deterministic classifiers will initialise
+% differently on each worker, so RAND_STATE_INT no longer reproduces
+% the results exactly.
 
 % See the manual for more documentation about the results
 % structure.
@@ -108,6 +117,7 @@ defaults.perfmet_args = struct([]);
 defaults.postproc_funct = '';
 defaults.ignore_unknowns = false;
 defaults.allow_single_object = false;
+defaults.parfor_workers = 0;
 args = propval(varargin,defaults);
 
 % User-specified perfmet_args must be a cell array with a struct in
@@ -186,138 +196,196 @@ store_perfs = [];
 disp( sprintf('Starting %i cross-validation classification iterations - %s', ...
 	      nIterations,class_args.train_funct_name) );
 
+iterations = cell(1,nIterations);
+
+if args.parfor_workers
+  [fold_pats fold_sels] = gather_iterations(subj,patnames,masknames,selnames);
+  parfor (n=1:nIterations, args.parfor_workers)
+    iterations{n} = run_iteration(fold_pats{n},fold_sels{n},regressors, ...
+                                  n,nIterations,patnames{n},masknames{n}, ...
+                                  selnames{n},regsname,class_args,args);
+  end % n nIterations
+  fold_pats = [];
+
+else
+  for n=1:nIterations
+    % Don't bother getting the pattern for iterations that are going
+    % to be skipped
+    selectors = get_mat(subj,'selector',selnames{n});
+    masked_pats = [];
+    if any(selectors==1 | selectors==2)
+      masked_pats = get_masked_pattern(subj,patnames{n},masknames{n});
+    end
+    iterations{n} = run_iteration(masked_pats,selectors,regressors, ...
+                                  n,nIterations,patnames{n},masknames{n}, ...
+                                  selnames{n},regsname,class_args,args);
+  end % n nIterations
+end
+
 for n=1:nIterations
+  % Skipped iterations come back empty
+  if isempty(iterations{n})
+    continue
+  end
+  % nPerfs x nIterations
+  store_perfs(:,n) = iterations{n}.perf';
+  results.iterations(n) = iterations{n};
+end % n nIterations
+
+disp(' ');
+
+% Show me the money
+results.total_perf = nanmean(store_perfs,2);
+
+mainhist = sprintf( ...
+    'Cross-validation using %s and %s - got total_perfs - %s', ...
+    class_args.train_funct_name,class_args.test_funct_name, ...
+    num2str(results.total_perf'));
+
+results = add_results_history(results,mainhist,true);
+
+
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+function [cur_iteration] = run_iteration(masked_pats,selectors,regressors, ...
+                                         n,nIterations,cur_patname,cur_maskname, ...
+                                         cur_selsname,regsname,class_args,args)
 
-  fprintf('\t%i',n);  
+% Trains and tests the classifier for a single iteration. Returns
+% an empty CUR_ITERATION if there's nothing to train or test on. This
+% gets called from inside a PARFOR, so it mustn't need the SUBJ
+
+fprintf('\t%i',n);  
+cur_iteration = [];
+nPerfs = length(args.perfmet_functs);
+
+cv_args.cur_iteration = n;
+cv_args.n_iterations = nIterations;
+
+% Extract the training and testing indices from the selector
+train_idx = find(selectors==1);
+test_idx  = find(selectors==2);
+unused_idx  = find(selectors==0);
+unknown_idx = selectors;
+unknown_idx([train_idx test_idx unused_idx]) = [];
+if length(unknown_idx) & ~args.ignore_unknowns
+  warning( sprintf('There are unknown selector labels in %s',cur_selsname) );
+end
+
+if isempty(train_idx) && isempty(test_idx)
+  disp('No pats and targs timepoints for this iteration - skipping');
   cur_iteration = [];
+  return
+end
 
-  cv_args.cur_iteration = n;
-  cv_args.n_iterations = nIterations;
-  
-  % Set the current selector up
-  cur_selsname = selnames{n};
-  selectors = get_mat(subj,'selector',cur_selsname);
+assert(strcmp(class(masked_pats),'double'));
 
-  % Set up the current pattern
-  cur_patname = patnames{n};
-  
-  % Extract the training and testing indices from the selector
-  train_idx = find(selectors==1);
-  test_idx  = find(selectors==2);
-  unused_idx  = find(selectors==0);
-  unknown_idx = selectors;
-  unknown_idx([train_idx test_idx unused_idx]) = [];
-  if length(unknown_idx) & ~args.ignore_unknowns
-    warning( sprintf('There are unknown selector labels in %s',cur_selsname) );
-  end
+% Create the training patterns and targets
+trainpats  = masked_pats(:,train_idx);
+traintargs = regressors( :,train_idx);
+testpats   = masked_pats(:,test_idx);
+testtargs  = regressors( :,test_idx);
 
-  if isempty(train_idx) && isempty(test_idx)
-    disp('No pats and targs timepoints for this iteration - skipping');
-    continue
-  end
+% Create a function handle for the classifier training function
+train_funct_hand = str2func(class_args.train_funct_name);
+
+% Call whichever training function
+scratchpad = train_funct_hand(trainpats,traintargs,class_args,cv_args);
+
+% Create a function handle for the classifier testing function
+test_funct_hand = str2func(class_args.test_funct_name);
+
+% Call whichever testing function
+[acts scratchpad] = test_funct_hand(testpats,testtargs,scratchpad);  
+
+% If a post-processing function has been specified,
+% call it on the acts and scratchpad.
+if ~isempty(args.postproc_funct)
+  postproc_funct_hand = str2func(args.postproc_funct);
+  [acts scratchpad] = postproc_funct_hand(acts,scratchpad);
+end
+  
+% this is redundant, but it's the easiest way of
+% passing the current information to the perfmet
+scratchpad.cur_iteration = n;
 
-  % Set the current mask up
-  cur_maskname = masknames{n};
-  masked_pats = get_masked_pattern(subj,cur_patname,cur_maskname);
+% Run all the perfmet functions on the classifier outputs
+% and store the resulting perfmet structure in a cell
+for p=1:nPerfs
   
-  assert(strcmp(class(masked_pats),'double'));
+  % Get the name of the perfmet function
+  cur_pm_name = args.perfmet_functs{p};
   
-  % Create the training patterns and targets
-  trainpats  = masked_pats(:,train_idx);
-  traintargs = regressors( :,train_idx);
-  testpats   = masked_pats(:,test_idx);
-  testtargs  = regressors( :,test_idx);
+  % Create a function handle to it
+  cur_pm_fh = str2func(cur_pm_name);
   
-  % Create a function handle for the classifier training function
-  train_funct_hand = str2func(class_args.train_funct_name);
-
-  % Call whichever training function
-  scratchpad = train_funct_hand(trainpats,traintargs,class_args,cv_args);
-
-  % Create a function handle for the classifier testing function
-  test_funct_hand = str2func(class_args.test_funct_name);
+  % Run the perfmet function and get an object back
+  cur_pm = cur_pm_fh(acts,testtargs,scratchpad,args.perfmet_args{p});
   
-  % Call whichever testing function
-  [acts scratchpad] = test_funct_hand(testpats,testtargs,scratchpad);  
+  % Add the function's name to the object
+  cur_pm.function_name = cur_pm_name;
   
-  % If a post-processing function has been specified,
-  % call it on the acts and scratchpad.
-  if ~isempty(args.postproc_funct)
-    postproc_funct_hand = str2func(args.postproc_funct);
-    [acts scratchpad] = postproc_funct_hand(acts,scratchpad);
+  % Append this perfmet object to the array of perfmet objects,
+  % only using a cell array if necessary
+  if nPerfs==1
+    cur_iteration.perfmet = cur_pm;
+  else
+    cur_iteration.perfmet{p} = cur_pm;
   end
-    
-  % this is redundant, but it's the easiest way of
-  % passing the current information to the perfmet
-  scratchpad.cur_iteration = n;
-  
-  % Run all the perfmet functions on the classifier outputs
-  % and store the resulting perfmet structure in a cell
-  for p=1:nPerfs
-    
-    % Get the name of the perfmet function
-    cur_pm_name = args.perfmet_functs{p};
-    
-    % Create a function handle to it
-    cur_pm_fh = str2func(cur_pm_name);
-    
-    % Run the perfmet function and get an object back
-    cur_pm = cur_pm_fh(acts,testtargs,scratchpad,args.perfmet_args{p});
-    
-    % Add the function's name to the object
-    cur_pm.function_name = cur_pm_name;
-    
-    % Append this perfmet object to the array of perfmet objects,
-    % only using a cell array if necessary
-    if nPerfs==1
-      cur_iteration.perfmet = cur_pm;
-    else
-      cur_iteration.perfmet{p} = cur_pm;
-    end
 
-    % Store this iteration's performance. If it's a NaN, the NANMEAN
-    % call below will ignore it. Updated on 080910 to store NaNs.
-    cur_iteration.perf(p) = cur_pm.perf;
-    % nPerfs x nIterations
-    store_perfs(p,n) = cur_iteration.perf(p);
+  % Store this iteration's performance. If it's a NaN, the NANMEAN
+  % call below will ignore it. Updated on 080910 to store NaNs.
+  cur_iteration.perf(p) = cur_pm.perf;
 
-  end
-  
-  % Display the performance for this iteration
-  disp( sprintf('\t%.2f',cur_iteration.perf(p)) );
-
-  % Book-keep the bountiful insight from this iteration
-  cur_iteration.created.datetime  = datetime(true);
-  cur_iteration.train_idx         = train_idx;
-  cur_iteration.test_idx          = test_idx;
-  cur_iteration.unused_idx        = unused_idx;
-  cur_iteration.unknown_idx       = unknown_idx;
-  cur_iteration.acts              = acts;
-  cur_iteration.scratchpad        = scratchpad;
-  cur_iteration.header.history    = []; % should fill this in xxx
-  cur_iteration.created.function  = 'cross_validation';
-  cur_iteration.created.patname   = cur_patname;
-  cur_iteration.created.regsname  = regsname;
-  cur_iteration.created.maskname  = cur_maskname;
-  cur_iteration.created.selname   = cur_selsname;
-  cur_iteration.train_funct_name  = class_args.train_funct_name;
-  cur_iteration.test_funct_name   = class_args.test_funct_name;
-  cur_iteration.args              = args;
-  results.iterations(n) = cur_iteration;
-  
-end % for n nIterations  
+end
 
-disp(' ');
+% Display the performance for this iteration
+disp( sprintf('\t%.2f',cur_iteration.perf(p)) );
+
+% Book-keep the bountiful insight from this iteration
+cur_iteration.created.datetime  = datetime(true);
+cur_iteration.train_idx         = train_idx;
+cur_iteration.test_idx          = test_idx;
+cur_iteration.unused_idx        = unused_idx;
+cur_iteration.unknown_idx       = unknown_idx;
+cur_iteration.acts              = acts;
+cur_iteration.scratchpad        = scratchpad;
+cur_iteration.header.history    = []; % should fill this in xxx
+cur_iteration.created.function  = 'cross_validation';
+cur_iteration.created.patname   = cur_patname;
+cur_iteration.created.regsname  = regsname;
+cur_iteration.created.maskname  = cur_maskname;
+cur_iteration.created.selname   = cur_selsname;
+cur_iteration.train_funct_name  = class_args.train_funct_name;
+cur_iteration.test_funct_name   = class_args.test_funct_name;
+cur_iteration.args              = args;
 
-% Show me the money
-results.total_perf = nanmean(store_perfs,2);
 
-mainhist = sprintf( ...
-    'Cross-validation using %s and %s - got total_perfs - %s', ...
-    class_args.train_funct_name,class_args.test_funct_name, ...
-    num2str(results.total_perf'));
 
-results = add_results_history(results,mainhist,true);
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+function [fold_pats fold_sels] = gather_iterations(subj,patnames,masknames,selnames)
+
+% Gets each iteration's masked pattern and selector out of the SUBJ
+% ahead of time, so that the PARFOR doesn't need it. Iterations with
+% the same pattern and mask get the same matrix, so copy-on-write
+% keeps just the one copy
+
+nIterations = length(selnames);
+fold_pats = cell(1,nIterations);
+fold_sels = cell(1,nIterations);
+keys = {};
+
+for n=1:nIterations
+  fold_sels{n} = get_mat(subj,'selector',selnames{n});
+
+  cur_key = sprintf('%s|%s',patnames{n},masknames{n});
+  prev = strmatch(cur_key,keys,'exact');
+  if isempty(prev)
+    fold_pats{n} = get_masked_pattern(subj,patnames{n},masknames{n});
+  else
+    fold_pats{n} = fold_pats{prev(1)};
+  end
+  keys{n} = cur_key;
+end % n nIterations
 
 
 
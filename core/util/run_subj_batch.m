@@ -0,0 +1,666 @@
+function [results report] = run_subj_batch(exp_name,ids,stages,varargin)
+
+% Runs the same pipeline over many subjects under a RAM budget
+%
+% [RESULTS REPORT] = RUN_SUBJ_BATCH(EXP_NAME,IDS,STAGES,...)
+%
+% Every subject gets its own freshly-initialized SUBJ structure
+% (INIT_SUBJ(EXP_NAME,ID)), which is then fed through each of the
+% STAGES in turn. Subjects are farmed out to a local pool of workers
+% with PARFOR, but only as many at a time as will fit inside
+% RAM_BUDGET_GB. If no pool is open, a local one gets opened with as
+% many workers as will be used (PARPOOL, or MATLABPOOL on versions
+% before R2013b). An existing pool gets used as it is, even if it's
+% smaller. Without the Parallel Computing Toolbox, everything runs
+% one after another, with a warning. If a subject grows beyond its share of the budget,
+% its biggest patterns are moved to the hard disk with
+% MOVE_PATTERN_TO_HD, so that later stages can carry on as usual
+% (GET_MAT transparently reads them back in).
+%
+% IDS is a cell array of subject ID strings.
+%
+% STAGES is a struct array describing the per-subject pipeline. Each
+% stage has the following fields:
+%
+%   NAME - a string that identifies this stage in the RESULTS and
+%   REPORT. Must be a valid variable name.
+%
+%   FUNCT - the function handle or name to call, as
+%   SUBJ = FUNCT(SUBJ,ARGS{:})
+%
+%   ARGS (optional, default = {}) - either a cell array of
+%   arguments, or a function handle that takes the subject ID and
+%   returns that cell array (useful for per-subject filenames).
+%
+%   NARGOUT (optional, default = 1). If 2, the stage is called as
+%   [SUBJ OUT] = FUNCT(SUBJ,ARGS{:}), and OUT gets stored in
+%   RESULTS{S}.(NAME), e.g. for CROSS_VALIDATION.
+%
+% e.g.
+%   stages(1).name = 'load';
+%   stages(1).funct = @load_afni_pattern;
+%   stages(1).args = @(id) {'epi','VT_category-selective',get_raw_filenames(id)};
+%   ...
+%   stages(4).name = 'xval';
+%   stages(4).funct = @cross_validation;
+%   stages(4).args = {'epi_z','conds','runs_xval','epi_z_thresh0.05',class_args};
+%   stages(4).nargout = 2;
+%   [results report] = run_subj_batch('haxby8',{'tt','uu','vv'},stages, ...
+%                                     'ram_budget_gb',200);
+%
+% RESULTS is a cell array with one structure per subject, containing
+% the second output of every NARGOUT==2 stage.
+%
+% REPORT contains the scheduling decisions, and a REPORT.SUBJ struct
+% array with per-stage timing and memory for each subject:
+%
+%   ELAPSED_S - wall-clock seconds for the stage
+%
+%   EST_BYTES - estimated peak footprint of the stage, i.e. the
+%   in-RAM patterns (from their MATSIZE) after the stage, plus one
+%   working copy of the largest pattern beforehand
+%
+%   RESIDENT_BYTES - in-RAM pattern bytes after any spilling
+%
+%   RSS_BYTES, HWM_BYTES - resident set size of the worker process
+%   after the stage, and its peak during the stage, from
+%   /proc/self/status (NaN if unavailable). The peak gets reset
+%   before each stage through /proc/self/clear_refs - on kernels
+%   that won't let us, HWM_BYTES is the peak since the worker
+%   started instead
+%
+%   SPILLED - cell array of patterns moved to the hard disk
+%
+% REPORT.SUBJ(S).START_RSS_BYTES is the worker's RSS before that
+% subject started, and REPORT.SUBJ(S).BIGGEST_PATTERN_BYTES is the
+% biggest single pattern it ever had in RAM.
+%
+% If a subject throws an error, it gets recorded in REPORT.SUBJ(S).ERROR
+% and the batch carries on with the other subjects.
+%
+% RAM_BUDGET_GB (optional, default = Inf). Total RAM that the
+% workers running at once can use between them, including each
+% worker's own WORKER_BASELINE_GB. If Inf, then there's no spilling,
+% and NWORKERS subjects run at once.
+%
+% NWORKERS (optional, default = number of cores). The most subjects
+% that will ever run at once.
+%
+% BYTES_PER_SUBJ (optional, default = []). Estimated peak footprint of
+% a single subject. If empty, subjects get run on their own as
+% pilots until one of them finishes without an error, and the
+% biggest of its stage EST_BYTES is used. If none of them finish,
+% there's nothing left to run anyway.
+%
+% SAFETY_FACTOR (optional, default = 1.5). The pilot estimate is
+% multiplied by this, since the EST_BYTES ignore temporaries inside
+% each stage. Where /proc is available, the pilot's measured growth
+% (its biggest HWM_BYTES minus its START_RSS_BYTES) is used instead
+% if that's bigger, since that also counts selectors, masks,
+% results etc.
+%
+% WORKER_BASELINE_GB (optional, default = the client's current RSS,
+% or 1 GB if that's unavailable). What each MATLAB worker takes up
+% before it's given a subject. This gets charged against
+% RAM_BUDGET_GB for every subject running at once.
+%
+% SPILL_DIR (optional, default = ''). If not empty, each subject's
+% header.subdir (where MOVE_PATTERN_TO_HD puts things) is set to
+% SPILL_DIR/EXP_NAME_ID. Otherwise, INIT_SUBJ's default is used.
+%
+% SAVE_PATHFILESTEM (optional, default = ''). If not empty, each
+% subject gets saved at the end with SAVE_SUBJ as
+% SAVE_PATHFILESTEM_ID, with its RESULTS appended as 'results', and
+% along with any of its patterns that were moved to the hard disk. Otherwise, those spilled pattern files get
+% deleted once the subject is finished with (or fails). The SUBJ
+% structures themselves are not returned, to keep them out of the
+% client's RAM.
+%
+% FOLD_PARALLEL (optional, default = 'auto'). Stages that call
+% CROSS_VALIDATION can spread their folds over the workers (see its
+% PARFOR_WORKERS argument). MATLAB runs a PARFOR inside a PARFOR
+% worker one iteration at a time, so either several subjects run at
+% once, or one subject at a time runs in the client with its folds
+% spread over the pool. 'auto' picks whichever keeps more workers
+% busy. TRUE always spreads the folds if the budget allows even one
+% fold worker, and FALSE never does. Each fold worker is charged
+% WORKER_BASELINE_GB plus twice the pilot's biggest pattern (or a
+% whole BYTES_PER_SUBJ if there was no pilot).
+
+% License:
+%=====================================================================
+%
+% This is part of the Princeton MVPA toolbox, released under
+% the GPL. See http://www.csbmb.princeton.edu/mvpa for more
+% information.
+%
+% The Princeton MVPA toolbox is available free and
+% unsupported to those who might find it useful. We do not
+% take any responsibility whatsoever for any problems that
+% you have related to the use of the MVPA toolbox.
+%
+% ======================================================================
+
+
+if nargin<3
+  error('Need 3 arguments');
+end
+
+defaults.ram_budget_gb = Inf;
+defaults.nworkers = [];
+defaults.bytes_per_subj = [];
+defaults.safety_factor = 1.5;
+defaults.worker_baseline_gb = [];
+defaults.spill_dir = '';
+defaults.save_pathfilestem = '';
+defaults.fold_parallel = 'auto';
+args = propval(varargin,defaults);
+
+if ischar(ids)
+  ids = {ids};
+end
+
+if isempty(args.nworkers)
+  args.nworkers = default_nworkers();
+end
+
+stages = sanity_check(ids,stages,args);
+
+if isempty(args.worker_baseline_gb)
+  rss = get_proc_mem_bytes();
+  if isnan(rss)
+    rss = 1024^3;
+  end
+  args.worker_baseline_gb = rss / 1024^3;
+end
+
+nSubj = length(ids);
+budget_bytes = args.ram_budget_gb * 1024^3;
+baseline_bytes = args.worker_baseline_gb * 1024^3;
+
+results = cell(nSubj,1);
+subj_reports = cell(nSubj,1);
+
+batch_tic = tic;
+
+% If we don't know how big a subject is going to get, run subjects on
+% their own until one of them gets all the way through, and use it
+% as a yardstick for the rest. Their results are kept, so this isn't
+% wasted work. A subject that fails partway only tells us about the
+% stages it finished, so it doesn't count as a pilot
+first = 1;
+pilot_id = '';
+pilot_biggest_bytes = [];
+args.fold_workers = 0;
+if isempty(args.bytes_per_subj) && ~isinf(budget_bytes)
+  while first <= nSubj && isempty(pilot_id)
+    disp( sprintf('Running pilot subject %s to estimate memory',ids{first}) );
+    allot_bytes = max(0, budget_bytes - baseline_bytes);
+    [results{first} subj_reports{first}] = run_one_subj(exp_name,ids{first},stages,allot_bytes,args);
+    pilot = subj_reports{first};
+    if isempty(pilot.error)
+      pilot_id = ids{first};
+      % MAX ignores the NaNs we get without /proc
+      est_bytes = args.safety_factor * max([pilot.stages.est_bytes]);
+      measured_bytes = max([pilot.stages.hwm_bytes]) - pilot.start_rss_bytes;
+      args.bytes_per_subj = max([est_bytes measured_bytes]);
+      pilot_biggest_bytes = pilot.biggest_pattern_bytes;
+    end
+    first = first + 1;
+  end
+end
+
+% Work out how many subjects fit inside the budget at once. Always
+% allow at least one, and let it spill if it doesn't fit. If we
+% have a budget but no estimate (e.g. every pilot failed), play it
+% safe and run them one at a time
+if isinf(budget_bytes)
+  nConcurrent = args.nworkers;
+elseif isempty(args.bytes_per_subj)
+  nConcurrent = 1;
+else
+  nConcurrent = floor(budget_bytes / (baseline_bytes + args.bytes_per_subj));
+end
+nConcurrent = max(1, min([nConcurrent args.nworkers nSubj-first+1]));
+allot_bytes = max(0, budget_bytes / nConcurrent - baseline_bytes);
+
+% See whether spreading the folds over the pool would keep more
+% workers busy than running subjects side by side. The subject
+% itself lives in the client, and every fold worker gets charged for
+% its masked pattern and the training/testing copies of it
+if first<=nSubj && ~isequal(args.fold_parallel,false) && any(arrayfun(@is_xval_stage,stages))
+  if isempty(pilot_biggest_bytes)
+    fold_bytes = baseline_bytes + args.bytes_per_subj;
+  else
+    fold_bytes = baseline_bytes + 2*pilot_biggest_bytes;
+  end
+  if isinf(budget_bytes)
+    nFoldWorkers = args.nworkers;
+  elseif isempty(args.bytes_per_subj)
+    nFoldWorkers = 0;
+  else
+    nFoldWorkers = floor((budget_bytes - baseline_bytes - args.bytes_per_subj) / fold_bytes);
+  end
+  nFoldWorkers = max(0, min(nFoldWorkers, args.nworkers));
+
+  if nFoldWorkers > nConcurrent || (isequal(args.fold_parallel,true) && nFoldWorkers >= 1)
+    args.fold_workers = nFoldWorkers;
+    nConcurrent = 1;
+    if isinf(budget_bytes)
+      allot_bytes = Inf;
+    else
+      allot_bytes = max(0, budget_bytes - baseline_bytes - nFoldWorkers*fold_bytes);
+    end
+  end
+end
+
+if first <= nSubj
+  disp( sprintf('Running %i subjects, %i at a time (%.1f GB each), %i fold workers', ...
+                nSubj-first+1,nConcurrent,allot_bytes/1024^3,args.fold_workers) );
+end
+
+if first <= nSubj
+  open_pool( max(nConcurrent,args.fold_workers) );
+end
+
+if args.fold_workers
+  % One at a time in the client, so that CROSS_VALIDATION's own
+  % PARFOR gets the pool
+  for s=first:nSubj
+    [results{s} subj_reports{s}] = run_one_subj(exp_name,ids{s},stages,allot_bytes,args);
+  end % s nSubj
+else
+  parfor (s=first:nSubj, nConcurrent)
+    [results{s} subj_reports{s}] = run_one_subj(exp_name,ids{s},stages,allot_bytes,args);
+  end % s nSubj
+end
+
+report.exp_name = exp_name;
+report.ram_budget_gb = args.ram_budget_gb;
+report.nworkers = args.nworkers;
+report.nconcurrent = nConcurrent;
+report.fold_workers = args.fold_workers;
+report.worker_baseline_gb = args.worker_baseline_gb;
+report.bytes_per_subj = args.bytes_per_subj;
+report.allot_bytes = allot_bytes;
+report.pilot = ~isempty(pilot_id);
+report.pilot_id = pilot_id;
+report.elapsed_s = toc(batch_tic);
+report.subj = [subj_reports{:}];
+
+display_report(report);
+
+
+
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+function [results rep] = run_one_subj(exp_name,id,stages,allot_bytes,args)
+
+% Runs all the stages for a single subject, spilling patterns to
+% the hard disk whenever it goes over ALLOT_BYTES
+
+results = [];
+
+rep.id = id;
+rep.error = '';
+rep.elapsed_s = 0;
+rep.start_rss_bytes = get_proc_mem_bytes();
+rep.biggest_pattern_bytes = 0;
+rep.stages = struct('name',{},'elapsed_s',{},'est_bytes',{}, ...
+                    'resident_bytes',{},'rss_bytes',{},'hwm_bytes',{}, ...
+                    'spilled',{});
+
+saved = false;
+subj_tic = tic;
+
+try
+  if isempty(args.spill_dir)
+    subj = init_subj(exp_name,id);
+  else
+    subdir = sprintf('%s/%s_%s',args.spill_dir,exp_name,id);
+    subj = init_subj(exp_name,id,'subdir',subdir);
+  end
+
+  for st=1:length(stages)
+    cur = stages(st);
+
+    if isa(cur.args,'function_handle')
+      cur_args = cur.args(id);
+    else
+      cur_args = cur.args;
+    end
+    if args.fold_workers && is_xval_stage(cur)
+      cur_args = [cur_args {'parfor_workers',args.fold_workers}];
+    end
+
+    [dummy biggest_before] = get_resident_bytes(subj);
+
+    reset_proc_hwm();
+    stage_tic = tic;
+    if cur.nargout==2
+      [subj out] = feval(cur.funct,subj,cur_args{:});
+      results.(cur.name) = out;
+    else
+      subj = feval(cur.funct,subj,cur_args{:});
+    end
+    elapsed_s = toc(stage_tic);
+
+    [after biggest_after] = get_resident_bytes(subj);
+    rep.biggest_pattern_bytes = max([rep.biggest_pattern_bytes biggest_before biggest_after]);
+    [rss hwm] = get_proc_mem_bytes();
+    [subj spilled] = spill_patterns(subj,allot_bytes);
+
+    srep.name = cur.name;
+    srep.elapsed_s = elapsed_s;
+    srep.est_bytes = after + biggest_before;
+    srep.resident_bytes = get_resident_bytes(subj);
+    srep.rss_bytes = rss;
+    srep.hwm_bytes = hwm;
+    srep.spilled = spilled;
+    rep.stages(end+1) = srep;
+  end % st nStages
+
+  if ~isempty(args.save_pathfilestem)
+    save_subj(subj,'pathfilestem',sprintf('%s_%s',args.save_pathfilestem,id), ...
+              'append_results',results);
+    saved = true;
+  end
+
+catch
+  rep.error = lasterr;
+  warning('Subject %s failed: %s',id,rep.error);
+end
+
+% Nobody will ever look at the spilled patterns of a subject that
+% didn't get saved, so don't leave them lying around on the disk
+if ~saved && exist('subj','var')
+  remove_spilled(subj);
+end
+
+rep.elapsed_s = toc(subj_tic);
+
+
+
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+function [subj spilled] = spill_patterns(subj,allot_bytes)
+
+% Moves the biggest in-RAM patterns to the hard disk until the
+% subject fits inside ALLOT_BYTES again
+
+spilled = {};
+
+[resident biggest patbytes patnames] = get_resident_bytes(subj);
+if resident <= allot_bytes
+  return
+end
+
+[sorted order] = sort(patbytes,'descend');
+for p=order
+  if resident <= allot_bytes
+    break
+  end
+  subj = move_pattern_to_hd(subj,patnames{p});
+  resident = resident - patbytes(p);
+  spilled{end+1} = patnames{p};
+end % p
+
+
+
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+function [] = remove_spilled(subj)
+
+% Deletes the files for all the patterns that live on the hard
+% disk, and then the subject's subdir if that leaves it empty. If a
+% stage moved patterns to the hard disk itself and then failed, the
+% SUBJ we've got won't know about them, so they'll keep the subdir
+% from being removed - warn about those rather than deleting files
+% we can't account for
+
+nPats = length(subj.patterns);
+spilled = {};
+for p=1:nPats
+  cur_patname = get_name(subj,'pattern',p);
+  if exist_objfield(subj,'pattern',cur_patname,'movehd')
+    spilled{end+1} = cur_patname;
+  end
+end % p nPats
+
+if ~isempty(spilled)
+  subj = remove_object(subj,'pattern',spilled);
+end
+
+% RMDIR without 's' refuses to remove a directory that still has
+% something in it, which is what we want
+subdir = get_objsubfield(subj,'subj','','header','subdir');
+if exist(subdir,'dir')
+  [success msg] = rmdir(subdir);
+  if ~success
+    warning('Left %s behind on the hard disk: %s',subdir,msg);
+  end
+end
+
+
+
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+function [tot biggest patbytes patnames] = get_resident_bytes(subj)
+
+% Adds up the size of all the patterns that are still in RAM,
+% based on their MATSIZE. Patterns already on the hard disk don't
+% count
+
+patbytes = [];
+patnames = {};
+
+nPats = length(subj.patterns);
+for p=1:nPats
+  cur_patname = get_name(subj,'pattern',p);
+  if exist_objfield(subj,'pattern',cur_patname,'movehd')
+    continue
+  end
+  % GET_OBJFIELD won't hand out the MAT, and GET_MAT converts
+  % logicals, so go straight to the object to find out its class
+  obj = get_object(subj,'pattern',cur_patname);
+  patbytes(end+1) = prod(obj.matsize) * bytes_per_element(obj.mat);
+  patnames{end+1} = cur_patname;
+end % p nPats
+
+tot = sum(patbytes);
+biggest = max([0 patbytes]);
+
+
+
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+function [nBytes] = bytes_per_element(mat)
+
+switch class(mat)
+ case {'double','int64','uint64'}
+  nBytes = 8;
+ case {'single','int32','uint32'}
+  nBytes = 4;
+ case {'int16','uint16','char'}
+  nBytes = 2;
+ case {'int8','uint8','logical'}
+  nBytes = 1;
+ otherwise
+  nBytes = 8;
+end
+
+
+
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+function [rss hwm] = get_proc_mem_bytes()
+
+% Only Linux has /proc/self/status - everyone else gets NaNs
+
+rss = NaN;
+hwm = NaN;
+
+fid = fopen('/proc/self/status','r');
+if fid==-1
+  return
+end
+
+while true
+  line = fgetl(fid);
+  if ~ischar(line)
+    break
+  end
+  if strncmp(line,'VmRSS:',6)
+    rss = sscanf(line(7:end),'%d') * 1024;
+  elseif strncmp(line,'VmHWM:',6)
+    hwm = sscanf(line(7:end),'%d') * 1024;
+  end
+end
+fclose(fid);
+
+
+
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+function [] = open_pool(nWorkers)
+
+% Makes sure there's a pool for the PARFORs to use. A single worker
+% doesn't need one - the PARFOR just runs in the client
+
+if nWorkers < 2
+  return
+end
+
+try
+  if exist('gcp','file')
+    pool = gcp('nocreate');
+    if isempty(pool)
+      parpool('local',nWorkers);
+    elseif pool.NumWorkers < nWorkers
+      warning('The open pool only has %i workers - wanted %i',pool.NumWorkers,nWorkers);
+    end
+
+  elseif exist('matlabpool','file')
+    nOpen = matlabpool('size');
+    if ~nOpen
+      matlabpool('open','local',nWorkers);
+    elseif nOpen < nWorkers
+      warning('The open pool only has %i workers - wanted %i',nOpen,nWorkers);
+    end
+
+  else
+    warning('No Parallel Computing Toolbox - running one subject at a time');
+  end
+
+catch
+  warning('Couldn''t open a pool of %i workers, so running one at a time: %s', ...
+          nWorkers,lasterr);
+end
+
+
+
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+function [isit] = is_xval_stage(stage)
+
+funct = stage.funct;
+if isa(funct,'function_handle')
+  funct = func2str(funct);
+end
+isit = strcmp(funct,'cross_validation');
+
+
+
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+function [] = reset_proc_hwm()
+
+% Writing 5 to clear_refs resets VmHWM to the current RSS (Linux
+% 4.0 onwards), so that the next VmHWM is the peak since now
+
+fid = fopen('/proc/self/clear_refs','w');
+if fid==-1
+  return
+end
+fprintf(fid,'5');
+fclose(fid);
+
+
+
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+function [n] = default_nworkers()
+
+n = 1;
+try
+  n = feature('numcores');
+end
+
+
+
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+function [] = display_report(report)
+
+disp( sprintf('Finished %i subjects in %.1f s',length(report.subj),report.elapsed_s) );
+
+nSubj = length(report.subj);
+for s=1:nSubj
+  cur = report.subj(s);
+  if ~isempty(cur.error)
+    disp( sprintf('  %s\tFAILED: %s',cur.id,cur.error) );
+    continue
+  end
+  disp( sprintf('  %s\t%.1f s',cur.id,cur.elapsed_s) );
+  for st=1:length(cur.stages)
+    srep = cur.stages(st);
+    disp( sprintf('    %-20s %8.1f s  est %8.1f MB  peak %8.1f MB  spilled %i', ...
+                  srep.name,srep.elapsed_s,srep.est_bytes/1024^2, ...
+                  srep.hwm_bytes/1024^2,length(srep.spilled)) );
+  end % st
+end % s nSubj
+
+
+
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+function [stages] = sanity_check(ids,stages,args)
+
+if ~iscell(ids) || isempty(ids)
+  error('IDS should be a non-empty cell array of subject IDs');
+end
+
+if ~isstruct(stages) || isempty(stages)
+  error('STAGES should be a non-empty struct array');
+end
+
+if ~isfield(stages,'name') || ~isfield(stages,'funct')
+  error('Each stage needs a NAME and a FUNCT');
+end
+
+if ~isfield(stages,'args')
+  [stages.args] = deal({});
+end
+if ~isfield(stages,'nargout')
+  [stages.nargout] = deal(1);
+end
+
+for st=1:length(stages)
+  if ~isvarname(stages(st).name)
+    error('Stage name ''%s'' should be a valid variable name',stages(st).name);
+  end
+  if isempty(stages(st).args)
+    stages(st).args = {};
+  end
+  if isempty(stages(st).nargout)
+    stages(st).nargout = 1;
+  end
+  if ~ismember(stages(st).nargout,[1 2])
+    error('Stage ''%s'' NARGOUT should be 1 or 2',stages(st).name);
+  end
+end % st
+
+if args.nworkers < 1
+  error('NWORKERS should be at least 1');
+end
+
+if args.ram_budget_gb <= 0
+  error('RAM_BUDGET_GB should be positive');
+end
+
+if ~isequal(args.fold_parallel,'auto') && ~isequal(args.fold_parallel,true) && ...
+      ~isequal(args.fold_parallel,false)
+  error('FOLD_PARALLEL should be ''auto'', true or false');
+end
+
+if ~isempty(args.worker_baseline_gb) && args.worker_baseline_gb < 0
+  error('WORKER_BASELINE_GB can''t be negative');
+end
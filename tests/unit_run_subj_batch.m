@@ -0,0 +1,379 @@
+function [errmsgs warnmsgs] = unit_run_subj_batch()
+
+% [ERRMSGS WARNMSGS] = UNIT_RUN_SUBJ_BATCH()
+%
+% Tests RUN_SUBJ_BATCH on a few fake subjects, checking that
+% every stage runs for every subject, that second outputs end
+% up in the RESULTS, that the timing and memory reports are sane,
+% that a tiny RAM budget forces patterns onto the hard disk (and
+% cleans them up afterwards unless the subject gets saved), and
+% that a failing subject or pilot doesn't bring down the rest of
+% the batch, and that spreading CROSS_VALIDATION's folds over the
+% pool gives the same answers as running them one after another.
+%
+% ERRMSGS = cell array holding the error strings
+% describing any tests that failed. If this is empty,
+% that's a good thing
+%
+% WARNMSGS = cell array, like ERRMSGS, of tests that didn't pass
+% and didn't fail (e.g. because they weren't run)
+
+
+errmsgs = {};
+warnmsgs = {};
+
+spill_dir = 'unit_run_subj_batch_temp';
+save_dir = 'unit_run_subj_batch_save';
+have_proc = exist('/proc/self/status','file');
+
+
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+% this is a negative test.
+% this test should fail if the function works with no arguments.
+try
+  results = run_subj_batch();
+  errmsgs{end+1} = 'No arguments test:failed';
+end
+
+
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+% no budget - everything should stay in RAM
+
+ids = {'aa','bb','cc'};
+stages = create_fake_stages();
+
+[results report] = run_subj_batch('unit_run_subj_batch',ids,stages, ...
+                                  'nworkers',1);
+
+if length(results)~=length(ids) || length(report.subj)~=length(ids)
+  errmsgs{end+1} = 'No budget: wrong number of subjects';
+end
+
+for s=1:length(report.subj)
+  cur = report.subj(s);
+  if ~isempty(cur.error)
+    errmsgs{end+1} = sprintf('No budget: subject %s failed - %s',cur.id,cur.error);
+    continue
+  end
+  if length(cur.stages)~=length(stages)
+    errmsgs{end+1} = sprintf('No budget: subject %s missing stages',cur.id);
+  end
+  if any(~cellfun('isempty',{cur.stages.spilled}))
+    errmsgs{end+1} = sprintf('No budget: subject %s spilled',cur.id);
+  end
+  if ~isfield(results{s},'count') || results{s}.count~=2
+    errmsgs{end+1} = sprintf('No budget: subject %s has wrong results',cur.id);
+  end
+end % s
+
+if report.pilot
+  errmsgs{end+1} = 'No budget: should not have run a pilot';
+end
+
+% the reports - load creates a single 100x30 double pattern, and
+% nothing was in RAM before it
+for s=1:length(report.subj)
+  cur = report.subj(s);
+  if ~isempty(cur.error)
+    continue
+  end
+  if cur.elapsed_s<0 || any([cur.stages.elapsed_s]<0)
+    errmsgs{end+1} = sprintf('Report: subject %s has negative timings',cur.id);
+  end
+  if cur.stages(1).est_bytes ~= 100*30*8
+    errmsgs{end+1} = sprintf('Report: subject %s load est_bytes is %i',cur.id,cur.stages(1).est_bytes);
+  end
+  if cur.stages(1).resident_bytes ~= 100*30*8
+    errmsgs{end+1} = sprintf('Report: subject %s load resident_bytes is %i',cur.id,cur.stages(1).resident_bytes);
+  end
+  if have_proc
+    rss = [cur.stages.rss_bytes];
+    hwm = [cur.stages.hwm_bytes];
+    if any(~isfinite(rss)) || any(~isfinite(hwm)) || ~isfinite(cur.start_rss_bytes)
+      errmsgs{end+1} = sprintf('Report: subject %s memory not measured',cur.id);
+    elseif any(rss<=0) || any(hwm<rss)
+      errmsgs{end+1} = sprintf('Report: subject %s peak below its RSS',cur.id);
+    end
+  end
+end % s
+
+if ~have_proc
+  warnmsgs{end+1} = 'No /proc/self/status, so RSS and peak memory weren''t checked';
+end
+
+
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+% explicit BYTES_PER_SUBJ - no pilot, and the concurrency comes
+% straight from the budget
+
+[results report] = run_subj_batch('unit_run_subj_batch',ids,stages, ...
+                                  'nworkers',8, ...
+                                  'ram_budget_gb',1, ...
+                                  'worker_baseline_gb',0, ...
+                                  'bytes_per_subj',0.4*1024^3);
+
+if report.pilot
+  errmsgs{end+1} = 'Explicit bytes_per_subj: should not have run a pilot';
+end
+
+if report.nconcurrent~=2
+  errmsgs{end+1} = sprintf('Explicit bytes_per_subj: running %i at a time instead of 2',report.nconcurrent);
+end
+
+if report.allot_bytes ~= 0.5*1024^3
+  errmsgs{end+1} = 'Explicit bytes_per_subj: wrong allotment';
+end
+
+if any(~cellfun('isempty',{report.subj.error}))
+  errmsgs{end+1} = 'Explicit bytes_per_subj: some subjects failed';
+end
+
+
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+% tiny budget - the pilot should spill, and only one subject runs
+% at a time
+
+[results report] = run_subj_batch('unit_run_subj_batch',ids,stages, ...
+                                  'nworkers',4, ...
+                                  'ram_budget_gb',10000/1024^3, ...
+                                  'spill_dir',spill_dir);
+
+if ~report.pilot
+  errmsgs{end+1} = 'Tiny budget: should have run a pilot';
+end
+
+if report.nconcurrent~=1
+  errmsgs{end+1} = 'Tiny budget: should only run one subject at a time';
+end
+
+for s=1:length(report.subj)
+  cur = report.subj(s);
+  if ~isempty(cur.error)
+    errmsgs{end+1} = sprintf('Tiny budget: subject %s failed - %s',cur.id,cur.error);
+    continue
+  end
+  if ~ismember('epi',[cur.stages.spilled])
+    errmsgs{end+1} = sprintf('Tiny budget: subject %s didn''t spill',cur.id);
+  end
+  if cur.stages(end).resident_bytes > report.allot_bytes
+    errmsgs{end+1} = sprintf('Tiny budget: subject %s over its allotment',cur.id);
+  end
+  % the zscoring stage still has to be able to read the spilled
+  % pattern back in from the hard disk
+  if ~isfield(results{s},'count') || results{s}.count~=2
+    errmsgs{end+1} = sprintf('Tiny budget: subject %s has wrong results',cur.id);
+  end
+end % s
+
+
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+% a failing subject shouldn't stop the others
+
+[results report] = run_subj_batch('unit_run_subj_batch',{'aa','fail','cc'},stages, ...
+                                  'nworkers',1);
+
+if isempty(report.subj(2).error)
+  errmsgs{end+1} = 'Failing subject: error not recorded';
+end
+
+if ~isempty(report.subj(1).error) || ~isempty(report.subj(3).error)
+  errmsgs{end+1} = 'Failing subject: other subjects failed too';
+end
+
+
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+% a failing pilot shouldn't mean the budget gets ignored - the next
+% subject should become the pilot instead
+
+[results report] = run_subj_batch('unit_run_subj_batch',{'fail','aa','cc'},stages, ...
+                                  'nworkers',4, ...
+                                  'ram_budget_gb',10000/1024^3, ...
+                                  'spill_dir',spill_dir);
+
+if isempty(report.subj(1).error)
+  errmsgs{end+1} = 'Failing pilot: error not recorded';
+end
+
+if ~strcmp(report.pilot_id,'aa')
+  errmsgs{end+1} = 'Failing pilot: next subject not used as the pilot';
+end
+
+if isempty(report.bytes_per_subj) || report.bytes_per_subj<=0
+  errmsgs{end+1} = 'Failing pilot: no memory estimate';
+end
+
+if report.nconcurrent~=1
+  errmsgs{end+1} = 'Failing pilot: budget ignored';
+end
+
+if ~isempty(report.subj(2).error) || ~isempty(report.subj(3).error)
+  errmsgs{end+1} = 'Failing pilot: other subjects failed too';
+end
+
+
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+% SAVE_PATHFILESTEM - each subject gets saved, and its spilled
+% patterns have to stay on the disk for the saved subj to use
+
+save_spill_dir = sprintf('%s/spill',save_dir);
+mkdir(save_dir);
+
+[results report] = run_subj_batch('unit_run_subj_batch',ids,stages, ...
+                                  'nworkers',1, ...
+                                  'ram_budget_gb',10000/1024^3, ...
+                                  'spill_dir',save_spill_dir, ...
+                                  'save_pathfilestem',sprintf('%s/subj',save_dir));
+
+for s=1:length(ids)
+  saved_files = dir(sprintf('%s/subj_%s_*.mat',save_dir,ids{s}));
+  if isempty(saved_files)
+    errmsgs{end+1} = sprintf('Save: subject %s wasn''t saved',ids{s});
+  else
+    saved = load(sprintf('%s/%s',save_dir,saved_files(1).name));
+    if ~isfield(saved,'subj') || ~isfield(saved,'results') || ...
+          ~isequal(saved.results,results{s})
+      errmsgs{end+1} = sprintf('Save: subject %s saved without its results',ids{s});
+    end
+  end
+  spilled_files = dir(sprintf('%s/unit_run_subj_batch_%s/*.mat',save_spill_dir,ids{s}));
+  if isempty(spilled_files)
+    errmsgs{end+1} = sprintf('Save: subject %s''s spilled patterns got deleted',ids{s});
+  end
+end % s
+
+rmdir(save_dir,'s');
+
+
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+% fold-level parallelism - the folds of the xval stage get spread
+% over the workers, and should give exactly the same performance
+% as running them one after another (the correlation classifier is
+% deterministic, and the fake data is seeded by subject)
+
+xval_stages = create_fake_stages();
+xval_stages(end+1).name = 'xval_setup';
+xval_stages(end).funct = @setup_fake_xval;
+xval_stages(end+1).name = 'xval';
+xval_stages(end).funct = @cross_validation;
+class_args.train_funct_name = 'train_corr';
+class_args.test_funct_name = 'test_corr';
+xval_stages(end).args = {'epi_z','conds','runs_xval','wholevol',class_args};
+xval_stages(end).nargout = 2;
+
+[serial_results serial_report] = run_subj_batch('unit_run_subj_batch',ids,xval_stages, ...
+                                                'nworkers',2, ...
+                                                'fold_parallel',false);
+[fold_results fold_report] = run_subj_batch('unit_run_subj_batch',ids,xval_stages, ...
+                                            'nworkers',2, ...
+                                            'fold_parallel',true);
+
+if serial_report.fold_workers~=0
+  errmsgs{end+1} = 'Fold parallel: folds spread even though fold_parallel was false';
+end
+
+if fold_report.fold_workers~=2
+  errmsgs{end+1} = sprintf('Fold parallel: %i fold workers instead of 2',fold_report.fold_workers);
+end
+
+for s=1:length(ids)
+  if ~isempty(serial_report.subj(s).error) || ~isempty(fold_report.subj(s).error)
+    errmsgs{end+1} = sprintf('Fold parallel: subject %s failed - %s %s',ids{s}, ...
+                             serial_report.subj(s).error,fold_report.subj(s).error);
+    continue
+  end
+  if length(fold_results{s}.xval.iterations)~=3
+    errmsgs{end+1} = sprintf('Fold parallel: subject %s has the wrong number of iterations',ids{s});
+  end
+  if ~isequal(serial_results{s}.xval.total_perf,fold_results{s}.xval.total_perf)
+    errmsgs{end+1} = sprintf('Fold parallel: subject %s performance differs',ids{s});
+  end
+end % s
+
+
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+% bad stages
+
+try
+  bad = stages;
+  bad(1).name = 'not a name';
+  run_subj_batch('unit_run_subj_batch',ids,bad);
+  errmsgs{end+1} = 'Bad stage name test: failed';
+end
+
+try
+  bad = rmfield(stages,'funct');
+  run_subj_batch('unit_run_subj_batch',ids,bad);
+  errmsgs{end+1} = 'Missing funct test: failed';
+end
+
+
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+% none of those subjects got saved, so their spilled patterns
+% shouldn't have been left behind
+
+if ~exist(spill_dir,'dir')
+  errmsgs{end+1} = 'Spill cleanup: spill_dir was never created';
+else
+  leftovers = dir(spill_dir);
+  leftovers = setdiff({leftovers.name},{'.','..'});
+  if ~isempty(leftovers)
+    errmsgs{end+1} = sprintf('Spill cleanup: %i files left in spill_dir',length(leftovers));
+  end
+  rmdir(spill_dir,'s');
+end
+
+
+
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+function [stages] = create_fake_stages()
+
+stages(1).name = 'load';
+stages(1).funct = @load_fake_subj;
+stages(1).args = @(id) {id};
+
+stages(2).name = 'zscore';
+stages(2).funct = @zscore_runs;
+stages(2).args = {'epi','runs','use_mvpa_ver',true};
+
+stages(3).name = 'count';
+stages(3).funct = @count_patterns;
+stages(3).nargout = 2;
+
+
+
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+function [subj] = load_fake_subj(subj,id)
+
+if strcmp(id,'fail')
+  error('Deliberately failing subject %s',id);
+end
+
+% Seed by subject, so that the same subject gets the same data
+% every time
+rand('state',sum(double(id)));
+
+% 10 x 5 x 2 = 100 voxels, to match the pattern
+runs = [ones(1,10) 2*ones(1,10) 3*ones(1,10)];
+subj = initset_object(subj,'mask','wholevol',ones(10,5,2));
+subj = initset_object(subj,'pattern','epi',rand(100,30), ...
+                      'masked_by','wholevol');
+subj = initset_object(subj,'selector','runs',runs);
+
+
+
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+function [subj nPats] = count_patterns(subj)
+
+nPats = length(subj.patterns);
+
+
+
+%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%%
+function [subj] = setup_fake_xval(subj)
+
+% Two conditions, alternating, and one cross-validation fold per run
+conds = zeros(2,30);
+conds(1,1:2:end) = 1;
+conds(2,2:2:end) = 1;
+subj = initset_object(subj,'regressors','conds',conds);
+subj = create_xvalid_indices(subj,'runs');